@@ -12,9 +12,12 @@ if [ -z "$commit" ]; then
 fi
 readonly commit
 
+# The default is for debugging.  Give e.g. `CFLAGS='-O2 -flto'` for an optimized build.
+readonly cflags="${CFLAGS:--Og -ggdb}"
+
 set -o xtrace
 
 ${CC:-gcc} -Wall -Wextra -Wpedantic -pedantic-errors \
-           -Og -ggdb \
+           $cflags \
            -D __COMMIT__="\"$commit\"" \
            -o noctty "$selfDir"/noctty.c
@@ -22,17 +22,35 @@
  * ```gdb
  * set inferior-tty $THE_NEW_TTY
  * ```
+ *
+ * Instead of reading the pathname off the new terminal and typing it in, a command given to us can
+ * have the pathname substituted for every `{tty}` in it.  E.g., this writes a GDB script that can
+ * then be `source`d, while keeping the terminal open:
+ *
+ * ```shell
+ * mate-terminal --execute noctty 'echo "set inferior-tty {tty}" > /tmp/tty.gdb; sleep infinity'
+ * ```
+ *
+ * Since we run inside whichever terminal emulator was launched, we can also measure it, to help
+ * choose the fastest one.  `noctty --bench-terminal` reports its output throughput and its
+ * round-trip latency to answer a query.
  */
 
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
 #include <semaphore.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifndef __COMMIT__
@@ -67,11 +85,9 @@ print_tty(bool const verbose)
 
 
 static void
-sighup_action(void(*action)(int))
+signal_action(int const sig, void(*action)(int))
 {
-  int const r = sigaction(SIGHUP,
-                          &(struct sigaction const) { .sa_handler = action },
-                          NULL);
+  int const r = sigaction(sig, &(struct sigaction const) { .sa_handler = action }, NULL);
   if (r != 0) { bail("sigaction error"); }
 }
 
@@ -80,7 +96,7 @@ relinquish_controlling_tty(void)
 {
   // Must ignore SIGHUP because the TIOCNOTTY ioctl might send that signal to us.  Otherwise,
   // delivery of that signal would terminate us.
-  sighup_action(SIG_IGN);
+  signal_action(SIGHUP, SIG_IGN);
 
   int const controlling_tty = open("/dev/tty", O_RDWR | O_NOCTTY);
   if (controlling_tty == -1) {
@@ -93,7 +109,45 @@ relinquish_controlling_tty(void)
   }
 
   // Reinstate SIGHUP, just to go back to normal default.
-  sighup_action(SIG_DFL);
+  signal_action(SIGHUP, SIG_DFL);
+}
+
+
+static char *
+substitute_tty(char const * const command)
+{
+  static char const placeholder[] = "{tty}";
+  size_t const placeholder_len = sizeof placeholder - 1;
+
+  if (!strstr(command, placeholder)) {
+    char * const copy = strdup(command);
+    if (!copy) { bail("strdup error"); }
+    return copy;
+  }
+
+  char const * const tty = ttyname(STDIN_FILENO);
+  if (!tty) { bail("ttyname error"); }
+  size_t const tty_len = strlen(tty);
+
+  size_t count = 0;
+  for (char const *p = command; (p = strstr(p, placeholder)); p += placeholder_len) {
+    count++;
+  }
+
+  char * const result = malloc(strlen(command) - count * placeholder_len + count * tty_len + 1);
+  if (!result) { bail("malloc error"); }
+
+  char *out = result;
+  char const *in = command;
+  for (char const *p; (p = strstr(in, placeholder)); in = p + placeholder_len) {
+    memcpy(out, in, p - in);
+    out += p - in;
+    memcpy(out, tty, tty_len);
+    out += tty_len;
+  }
+  strcpy(out, in);
+
+  return result;
 }
 
 
@@ -127,11 +181,324 @@ block_forever(void)
 }
 
 
+/* Benchmarking of the terminal emulator that we're running in.  Payloads are written to the
+ * terminal followed by a Device Status Report (DSR) request.  An emulator answers the DSR only
+ * after it has processed everything before it, so the time until the answer arrives is the time
+ * the emulator took to process the payload. */
+
+static struct termios saved_termios;
+
+static char const reset_sgr[] = "\033[0m";
+
+// Used at exit and by the signal handler, so only async-signal-safe functions are used.
+static void
+restore_terminal(void)
+{
+  tcsetattr(STDIN_FILENO, TCSADRAIN, &saved_termios);
+  ssize_t const r = write(STDOUT_FILENO, reset_sgr, sizeof reset_sgr - 1);
+  (void) r;
+}
+
+// A terminating signal gives the terminal back as it was before re-raising the signal with its
+// default action, which happens once the handler returns and the signal is unblocked.
+static void
+restore_and_reraise(int const sig)
+{
+  restore_terminal();
+  sigaction(sig, &(struct sigaction const) { .sa_handler = SIG_DFL }, NULL);
+  raise(sig);
+}
+
+static void
+enter_noncanonical_mode(void)
+{
+  if (tcgetattr(STDIN_FILENO, &saved_termios) != 0) { bail("tcgetattr error"); }
+  if (atexit(restore_terminal) != 0) { bail("atexit error"); }
+
+  struct termios t = saved_termios;
+  t.c_lflag &= ~(ICANON | ECHO);
+  t.c_cc[VMIN] = 1;
+  t.c_cc[VTIME] = 0;
+
+  // Installed before changing the terminal, so that there is no window in which a signal could
+  // leave it changed.
+  int const terminating[] = { SIGINT, SIGTERM, SIGHUP, SIGQUIT };
+  for (size_t i = 0; i < sizeof terminating / sizeof terminating[0]; i++) {
+    signal_action(terminating[i], restore_and_reraise);
+  }
+
+  // Being stopped would count the stopped time as the emulator's, and the DSR answer could be read
+  // by the shell instead of us.  The benchmark only lasts seconds, so Ctrl-Z is ignored until it's
+  // done.
+  signal_action(SIGTSTP, SIG_IGN);
+
+  if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &t) != 0) { bail("tcsetattr error"); }
+}
+
+
+static double
+now(void)
+{
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) { bail("clock_gettime error"); }
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+write_all(char const *data, size_t len)
+{
+  while (len > 0) {
+    ssize_t const n = write(STDOUT_FILENO, data, len);
+    if (n == -1) {
+      if (errno == EINTR) { continue; }
+      bail("write error");
+    }
+    data += n;
+    len -= n;
+  }
+}
+
+// Returns the seconds from sending the DSR request until the emulator's answer is read.
+static double
+dsr_round_trip(double const start)
+{
+  static char const request[] = "\033[6n";
+  write_all(request, sizeof request - 1);
+
+  // The answer is `ESC [ row ; col R`.  Anything else, like keys typed meanwhile, is discarded.
+  enum { want_esc, want_bracket, want_row, in_row, want_col, in_col, done } state = want_esc;
+  while (state != done) {
+    struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+    int const r = poll(&pfd, 1, 10000);
+    if (r == -1) {
+      if (errno == EINTR) { continue; }
+      bail("poll error");
+    }
+    if (r == 0) {
+      fprintf(stderr, "error: terminal did not answer the DSR request\n");
+      exit(EXIT_FAILURE);
+    }
+
+    char input[32];
+    ssize_t const n = read(STDIN_FILENO, input, sizeof input);
+    if (n == -1) {
+      if (errno == EINTR) { continue; }
+      bail("read error");
+    }
+
+    for (ssize_t i = 0; i < n && state != done; i++) {
+      char const c = input[i];
+      bool const digit = '0' <= c && c <= '9';
+
+      if (c == '\033') { state = want_bracket; }
+      else if (state == want_bracket && c == '[') { state = want_row; }
+      else if ((state == want_row || state == in_row) && digit) { state = in_row; }
+      else if (state == in_row && c == ';') { state = want_col; }
+      else if ((state == want_col || state == in_col) && digit) { state = in_col; }
+      else if (state == in_col && c == 'R') { state = done; }
+      else { state = want_esc; }
+    }
+  }
+
+  return now() - start;
+}
+
+
+typedef struct buffer {
+  char *data;
+  size_t len;
+  size_t cap;
+} buffer;
+
+static void
+buffer_reserve(buffer * const buf, size_t const len)
+{
+  if (buf->len + len > buf->cap) {
+    buf->cap = 2 * (buf->len + len);
+    buf->data = realloc(buf->data, buf->cap);
+    if (!buf->data) { bail("realloc error"); }
+  }
+}
+
+static void
+buffer_append(buffer * const buf, char const * const data, size_t const len)
+{
+  buffer_reserve(buf, len);
+  memcpy(&buf->data[buf->len], data, len);
+  buf->len += len;
+}
+
+static void
+buffer_double(buffer * const buf)
+{
+  buffer_reserve(buf, buf->len);
+  memcpy(&buf->data[buf->len], buf->data, buf->len);
+  buf->len *= 2;
+}
+
+#define buffer_append_str(buf, str) buffer_append(buf, str, strlen(str))
+
+// Each payload is some number of repetitions of a unit.  Units never end in the middle of an
+// escape sequence, so that the following DSR request is not swallowed.
+
+static void
+plain_text_unit(buffer * const unit, unsigned short const rows, unsigned short const cols)
+{
+  (void) rows;
+  for (unsigned c = 0; c < cols - 1u; c++) {
+    buffer_append(unit, &(char) { '!' + c % 94 }, 1);
+  }
+  buffer_append_str(unit, "\r\n");
+}
+
+static void
+sgr_heavy_unit(buffer * const unit, unsigned short const rows, unsigned short const cols)
+{
+  (void) rows;
+  for (unsigned c = 0; c < cols - 1u; c++) {
+    char sgr[32];
+    int const n = snprintf(sgr, sizeof sgr, "\033[%d;38;5;%um%c",
+                           c % 2 ? 1 : 22, c % 256, '!' + c % 94);
+    buffer_append(unit, sgr, n);
+  }
+  buffer_append_str(unit, "\033[0m\r\n");
+}
+
+// Two frames that differ in every cell, so that each frame is a full redraw.
+static void
+full_screen_unit(buffer * const unit, unsigned short const rows, unsigned short const cols)
+{
+  for (unsigned f = 0; f < 2; f++) {
+    buffer_append_str(unit, "\033[H");
+    for (unsigned i = 0; i < (unsigned) rows * cols; i++) {
+      buffer_append(unit, &(char) { 'A' + (i + f) % 26 }, 1);
+    }
+  }
+}
+
+
+typedef struct payload_result {
+  size_t bytes;
+  size_t units;
+  double seconds;
+} payload_result;
+
+// Doubles the repetitions until a run takes long enough to not be dominated by the round-trip.
+static payload_result
+bench_payload(void (* const make_unit)(buffer *, unsigned short, unsigned short),
+              unsigned short const rows, unsigned short const cols)
+{
+  static double const min_seconds = 0.25;
+  static size_t const max_bytes = 64 << 20;
+
+  buffer unit = { 0 };
+  make_unit(&unit, rows, cols);
+
+  buffer payload = { 0 };
+  buffer_append(&payload, unit.data, unit.len);
+  size_t units = 1;
+
+  payload_result result;
+  for (;;) {
+    double const start = now();
+    write_all(payload.data, payload.len);
+    result = (payload_result) {
+      .bytes = payload.len,
+      .units = units,
+      .seconds = dsr_round_trip(start),
+    };
+
+    if (result.seconds >= min_seconds || 2 * payload.len > max_bytes) { break; }
+
+    buffer_double(&payload);
+    units *= 2;
+  }
+
+  free(payload.data);
+  free(unit.data);
+  return result;
+}
+
+
+static int
+compare_doubles(void const * const a, void const * const b)
+{
+  double const x = *(double const *) a, y = *(double const *) b;
+  return (x > y) - (x < y);
+}
+
+static int
+bench_terminal(void)
+{
+  if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO)) {
+    fprintf(stderr, "error: stdin and stdout must be the terminal to benchmark\n");
+    return EXIT_FAILURE;
+  }
+
+  struct winsize ws;
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_row == 0 || ws.ws_col < 2) {
+    ws = (struct winsize) { .ws_row = 24, .ws_col = 80 };
+  }
+
+  enter_noncanonical_mode();
+
+  enum { latency_samples = 100 };
+  double latencies[latency_samples];
+  for (int i = 0; i < latency_samples; i++) {
+    latencies[i] = dsr_round_trip(now());
+  }
+  qsort(latencies, latency_samples, sizeof latencies[0], compare_doubles);
+
+  struct {
+    char const *name;
+    void (*make_unit)(buffer *, unsigned short, unsigned short);
+    char const *unit_name;
+    size_t frames_per_unit;
+    payload_result result;
+  } payloads[] = {
+    { "plain text", plain_text_unit, "lines", 1, { 0 } },
+    { "SGR-heavy", sgr_heavy_unit, "lines", 1, { 0 } },
+    { "full-screen", full_screen_unit, "frames", 2, { 0 } },
+  };
+  size_t const payloads_count = sizeof payloads / sizeof payloads[0];
+
+  for (size_t i = 0; i < payloads_count; i++) {
+    payloads[i].result = bench_payload(payloads[i].make_unit, ws.ws_row, ws.ws_col);
+  }
+
+  // Also clears the scrollback, which the payloads filled with many MB of lines.
+  static char const reset[] = "\033[0m\033[H\033[2J\033[3J";
+  write_all(reset, sizeof reset - 1);
+
+  printf("Terminal benchmark (%ux%u):\n", ws.ws_col, ws.ws_row);
+  for (size_t i = 0; i < payloads_count; i++) {
+    payload_result const r = payloads[i].result;
+    printf("  %-12s %9.2f MB/s  %11.0f %s/s  (%zu bytes in %.0f ms)\n",
+           payloads[i].name,
+           r.bytes / r.seconds / 1e6,
+           r.units * payloads[i].frames_per_unit / r.seconds,
+           payloads[i].unit_name,
+           r.bytes,
+           r.seconds * 1e3);
+  }
+  printf("  DSR round-trip: min %.0f us, median %.0f us, max %.0f us (%d samples)\n",
+         latencies[0] * 1e6,
+         latencies[latency_samples / 2] * 1e6,
+         latencies[latency_samples - 1] * 1e6,
+         latency_samples);
+
+  return EXIT_SUCCESS;
+}
+
+
 static void
 print_help(FILE *stream, char const * const self)
 {
   fprintf(stream, "Usage: %s [-v] [COMMAND]\n", self);
+  fprintf(stream, "   or: %s -b\n", self);
   fprintf(stream, "Relinquish the controlling terminal. Optionally, run a command.\n");
+  fprintf(stream, "Every {tty} in COMMAND is replaced with the terminal's pathname.\n");
+  fprintf(stream, "With -b (--bench-terminal), instead benchmark the terminal emulator.\n");
   fprintf(stream, "(Built from %s on %s.)\n", __COMMIT__, __DATE__);
 }
 
@@ -139,6 +506,7 @@ print_help(FILE *stream, char const * const self)
 typedef struct options {
   char const *command;
   bool verbose;
+  bool bench_terminal;
 } options;
 
 static options
@@ -147,10 +515,18 @@ process_args(int const argc, char * const argv[])
   options opts = {
     .command = NULL,
     .verbose = false,
+    .bench_terminal = false,
+  };
+
+  static struct option const long_options[] = {
+    { "help", no_argument, NULL, 'h' },
+    { "verbose", no_argument, NULL, 'v' },
+    { "bench-terminal", no_argument, NULL, 'b' },
+    { NULL, 0, NULL, 0 },
   };
 
   int c;
-  while ((c = getopt(argc, argv, "hv")) != -1) {
+  while ((c = getopt_long(argc, argv, "hvb", long_options, NULL)) != -1) {
     switch (c) {
     case 'h':
       print_help(stdout, argv[0]);
@@ -159,6 +535,9 @@ process_args(int const argc, char * const argv[])
     case 'v':
       opts.verbose = true;
       break;
+    case 'b':
+      opts.bench_terminal = true;
+      break;
     case '?':
       exit(EXIT_FAILURE);
       break;
@@ -175,7 +554,7 @@ process_args(int const argc, char * const argv[])
     opts.command = posargv[0];
   }
 
-  if (posargc >= 2) {
+  if (posargc >= 2 || (opts.bench_terminal && (posargc >= 1 || opts.verbose))) {
     fprintf(stderr, "error: invalid arguments\n");
     fprintf(stderr, "\n");
     print_help(stderr, argv[0]);
@@ -191,12 +570,20 @@ main(int const argc, char * const argv[])
 {
   options const opts = process_args(argc, argv);
 
+  if (opts.bench_terminal) {
+    return bench_terminal();
+  }
+
   print_tty(opts.verbose);
 
+  char * const command = opts.command ? substitute_tty(opts.command) : NULL;
+
   relinquish_controlling_tty();
 
-  if (opts.command) {
-    return run_given_command(opts.command);
+  if (command) {
+    int const status = run_given_command(command);
+    free(command);
+    return status;
   }
   else {
     block_forever();